@@ -0,0 +1,171 @@
+// Copyright (c) 2022 Darryl Pogue
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/**
+ * Measures the runtime cost of availability checks: the first (cold) check
+ * including loading the system version, the warm check, checks with 1 to 5
+ * alternatives, and the first check made by many threads at once.
+ */
+
+#include <windows_availability>
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace wa = __builtin_availability;
+using namespace wa::literals;
+
+/**
+ * Forgets the cached system version, so the next check has to load it.
+ */
+static void resetSystemVersion() {
+    wa::systemVersion.store(0, std::memory_order_relaxed);
+}
+
+static void BM_LoadSystemVersion(benchmark::State& state) {
+    for (auto _ : state) {
+        resetSystemVersion();
+        benchmark::DoNotOptimize(wa::_loadSystemVersion());
+    }
+}
+BENCHMARK(BM_LoadSystemVersion);
+
+// With WINDOWS_AVAILABILITY_EAGER_INIT, checks never load the version, so
+// after a reset they would only time a comparison against 0
+#ifndef WINDOWS_AVAILABILITY_EAGER_INIT
+static void BM_ColdIsVersionAtLeast(benchmark::State& state) {
+    for (auto _ : state) {
+        resetSystemVersion();
+        benchmark::DoNotOptimize(wa::_isVersionAtLeast(wa::detail::requiredVersion("Windows 10 1809")));
+    }
+}
+BENCHMARK(BM_ColdIsVersionAtLeast);
+#endif
+
+static void BM_WarmIsVersionAtLeast(benchmark::State& state) {
+    wa::initialize();
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(wa::_isVersionAtLeast(wa::detail::requiredVersion("Windows 10 1809")));
+}
+BENCHMARK(BM_WarmIsVersionAtLeast);
+
+static void BM_WarmMacro1(benchmark::State& state) {
+    wa::initialize();
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(__builtin_available(Windows 10 1809));
+}
+BENCHMARK(BM_WarmMacro1);
+
+static void BM_WarmMacro2(benchmark::State& state) {
+    wa::initialize();
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(__builtin_available(Windows 11 22H2, Windows 10 1809));
+}
+BENCHMARK(BM_WarmMacro2);
+
+static void BM_WarmMacro3(benchmark::State& state) {
+    wa::initialize();
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(__builtin_available(Windows 11 22H2, Windows 11, Windows 10 1809));
+}
+BENCHMARK(BM_WarmMacro3);
+
+static void BM_WarmMacro4(benchmark::State& state) {
+    wa::initialize();
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(__builtin_available(macOS 10.15, Windows 11 22H2, Windows 11, Windows 10 1809));
+}
+BENCHMARK(BM_WarmMacro4);
+
+static void BM_WarmMacro5(benchmark::State& state) {
+    wa::initialize();
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(__builtin_available(macOS 10.15, iOS 13, Windows 11 22H2, Windows 11, Windows 10 1809));
+}
+BENCHMARK(BM_WarmMacro5);
+
+static void BM_WarmMacroUnavailable(benchmark::State& state) {
+    wa::initialize();
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(__builtin_available(Windows 99));
+}
+BENCHMARK(BM_WarmMacroUnavailable);
+
+static void BM_WarmSnapshot(benchmark::State& state) {
+    auto caps = wa::snapshot();
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(caps.atLeast("Windows 10 1809"_winver));
+}
+BENCHMARK(BM_WarmSnapshot);
+
+#ifndef WINDOWS_AVAILABILITY_EAGER_INIT
+/**
+ * Starts `state.range(0)` threads that all make their first check at the
+ * same moment, and times how long it takes until every one has an answer.
+ */
+static void BM_ContendedFirstUse(benchmark::State& state) {
+    const int threadCount = static_cast<int>(state.range(0));
+
+    for (auto _ : state) {
+        resetSystemVersion();
+
+        std::atomic<int> ready{0};
+        std::atomic<bool> go{false};
+        std::vector<std::thread> threads;
+
+        for (int i = 0; i < threadCount; i++) {
+            threads.emplace_back([&ready, &go] {
+                ready.fetch_add(1);
+                while (!go.load(std::memory_order_acquire))
+                    std::this_thread::yield();
+
+                benchmark::DoNotOptimize(wa::_isVersionAtLeast(wa::detail::requiredVersion("Windows 10 1809")));
+            });
+        }
+
+        while (ready.load() != threadCount)
+            std::this_thread::yield();
+
+        auto start = std::chrono::high_resolution_clock::now();
+        go.store(true, std::memory_order_release);
+
+        for (std::thread& thread : threads)
+            thread.join();
+
+        auto end = std::chrono::high_resolution_clock::now();
+        state.SetIterationTime(std::chrono::duration<double>(end - start).count());
+    }
+}
+BENCHMARK(BM_ContendedFirstUse)->RangeMultiplier(2)->Range(1, 64)->UseManualTime();
+#endif
+
+BENCHMARK_MAIN();
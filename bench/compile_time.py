@@ -0,0 +1,241 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2022 Darryl Pogue
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""Measures the compile-time cost of availability checks.
+
+Generates translation units with 0, 1000 and 10000 synthetic
+__builtin_available checks covering every name form the parser understands,
+then reports for each compiler:
+
+  * preprocessing time
+  * frontend (syntax-only) time
+  * the constexpr step limit needed by the most expensive check
+  * object size at -O2 / /O2
+
+The 0-check unit is the baseline for the header itself, so the deltas show
+what each check costs. Run it before and after a change to the parser or the
+macros, e.g.:
+
+    python3 bench/compile_time.py --compiler clang-cl --compiler cl
+    python3 bench/compile_time.py --compiler x86_64-w64-mingw32-g++
+
+Pass --ftime-trace with clang to also keep a -ftime-trace JSON per unit, and
+--lightweight to leave <windows.h> out of the measurement.
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+INCLUDE_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "include")
+
+# Every name form the parser understands
+VERSION_FORMS = [
+    "Windows XP",
+    "Windows Vista",
+    "Windows 7",
+    "Windows 8",
+    "Windows 8.1",
+    "Windows 10",
+    "Windows 10 1809",
+    "Windows 10 21H2",
+    "Windows 11",
+    "Windows 11 22H2",
+    "Windows Server 2012 R2",
+    "Windows Server 2022",
+    "Windows 6.1",
+    "Windows 10.0.19041",
+    "Windows 10.0.19045.3570",
+]
+
+# Alternatives that the parser has to skip over
+OTHER_PLATFORMS = ["macOS 10.15", "iOS 13"]
+
+
+def generate(count, path, lightweight):
+    """Writes a translation unit with `count` checks to `path`.
+
+    The checks cycle through every name form, and every third one also has
+    a raw build alternative with its own build number, so that most checks
+    are distinct constant evaluations rather than repeats the compiler can
+    memoize.
+    """
+    with open(path, "w", newline="\n") as f:
+        if lightweight:
+            f.write("#define WINDOWS_AVAILABILITY_NO_WINDOWS_H\n")
+        f.write("#include <windows_availability>\n\n")
+
+        raw = 0
+        for i in range(count):
+            args = VERSION_FORMS[i % len(VERSION_FORMS)]
+            if i % 3 == 0:
+                args += ", Windows 10.0.%d" % (10240 + raw)
+                raw += 1
+            if i % 5 == 0:
+                args = OTHER_PLATFORMS[i % len(OTHER_PLATFORMS)] + ", " + args
+
+            f.write("bool check%d() { return __builtin_available(%s); }\n" % (i, args))
+
+
+def is_msvc(compiler):
+    name = os.path.basename(compiler).lower()
+    return name.startswith("clang-cl") or name in ("cl", "cl.exe")
+
+
+def is_clang(compiler):
+    return "clang" in os.path.basename(compiler).lower()
+
+
+def base_flags(compiler, extra):
+    if is_msvc(compiler):
+        return ["/nologo", "/std:c++20", "/EHsc", "/I" + INCLUDE_DIR] + extra
+    return ["-std=c++20", "-I" + INCLUDE_DIR] + extra
+
+
+def timed(cmd):
+    """Runs `cmd`, returning the elapsed seconds, or None if it failed."""
+    start = time.perf_counter()
+    result = subprocess.run(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    elapsed = time.perf_counter() - start
+
+    if result.returncode != 0:
+        return None
+    return elapsed
+
+
+def preprocess_time(compiler, source, flags, outdir):
+    if is_msvc(compiler):
+        return timed([compiler] + flags + ["/P", "/Fi" + os.path.join(outdir, "out.i"), source])
+    return timed([compiler] + flags + ["-E", "-o", os.devnull, source])
+
+
+def frontend_time(compiler, source, flags, trace):
+    if is_msvc(compiler):
+        return timed([compiler] + flags + ["/Zs", source])
+
+    extra = ["-fsyntax-only"]
+    if trace and is_clang(compiler):
+        extra.append("-ftime-trace")
+    return timed([compiler] + flags + extra + [source])
+
+
+def step_flag(compiler, steps):
+    if is_msvc(compiler):
+        if is_clang(compiler):
+            return ["/clang:-fconstexpr-steps=%d" % steps]
+        return ["/constexpr:steps%d" % steps]
+    if is_clang(compiler):
+        return ["-fconstexpr-steps=%d" % steps]
+    return ["-fconstexpr-ops-limit=%d" % steps]
+
+
+def constexpr_steps(compiler, source, flags):
+    """Finds the smallest constexpr step limit that still compiles the unit.
+
+    The limit applies to each constant evaluation on its own, so this is the
+    cost of the most expensive check rather than the total for the unit.
+    """
+    syntax = ["/Zs"] if is_msvc(compiler) else ["-fsyntax-only"]
+
+    def compiles(steps):
+        cmd = [compiler] + flags + syntax + step_flag(compiler, steps) + [source]
+        return subprocess.run(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL).returncode == 0
+
+    low, high = 1, 1 << 16
+    while not compiles(high):
+        low = high
+        high *= 2
+        if high > (1 << 30):
+            return None
+
+    while low < high:
+        mid = (low + high) // 2
+        if compiles(mid):
+            high = mid
+        else:
+            low = mid + 1
+    return high
+
+
+def object_size(compiler, source, flags, outdir):
+    obj = os.path.join(outdir, "out.obj")
+    if is_msvc(compiler):
+        cmd = [compiler] + flags + ["/O2", "/c", "/Fo" + obj, source]
+    else:
+        cmd = [compiler] + flags + ["-O2", "-c", "-o", obj, source]
+
+    if subprocess.run(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL).returncode != 0:
+        return None
+    return os.path.getsize(obj)
+
+
+def fmt(value, unit=""):
+    if value is None:
+        return "failed"
+    if isinstance(value, float):
+        return "%.3f%s" % (value, unit)
+    return "%d%s" % (value, unit)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--compiler", action="append", help="compiler to measure (repeatable)")
+    parser.add_argument("--count", action="append", type=int, help="number of checks per unit (repeatable)")
+    parser.add_argument("--flag", action="append", default=[], help="extra compiler flag (repeatable)")
+    parser.add_argument("--lightweight", action="store_true", help="define WINDOWS_AVAILABILITY_NO_WINDOWS_H")
+    parser.add_argument("--ftime-trace", action="store_true", help="keep clang -ftime-trace output")
+    parser.add_argument("--keep", metavar="DIR", help="write the generated units to DIR")
+    args = parser.parse_args()
+
+    compilers = args.compiler or (["cl"] if sys.platform == "win32" else ["c++"])
+    counts = args.count or [0, 1000, 10000]
+
+    outdir = args.keep or tempfile.mkdtemp(prefix="wa_compile_bench_")
+    os.makedirs(outdir, exist_ok=True)
+
+    print("%-24s %7s %12s %12s %14s %12s" % ("compiler", "checks", "preproc (s)", "frontend (s)", "constexpr ops", "object (B)"))
+
+    for compiler in compilers:
+        flags = base_flags(compiler, args.flag)
+
+        for count in counts:
+            source = os.path.join(outdir, "checks_%d.cpp" % count)
+            generate(count, source, args.lightweight)
+
+            pre = preprocess_time(compiler, source, flags, outdir)
+            front = frontend_time(compiler, source, flags, args.ftime_trace)
+            steps = constexpr_steps(compiler, source, flags) if count else None
+            size = object_size(compiler, source, flags, outdir)
+
+            print("%-24s %7d %12s %12s %14s %12s" % (
+                os.path.basename(compiler), count, fmt(pre), fmt(front),
+                fmt(steps) if count else "-", fmt(size)))
+
+    if not args.keep:
+        print("\nGenerated units are in " + outdir)
+
+
+if __name__ == "__main__":
+    main()
@@ -24,18 +24,171 @@
 
 #ifdef _WIN32
 
+// Exporting check sites at exit needs them to be recorded
+#if defined(WINDOWS_AVAILABILITY_TELEMETRY) && !defined(WINDOWS_AVAILABILITY_INSTRUMENT)
+#define WINDOWS_AVAILABILITY_INSTRUMENT
+#endif
+
+/**
+ * With `WINDOWS_AVAILABILITY_KERNEL_MODE` defined, this header can be used in
+ * drivers: it includes <wdm.h> instead of <windows.h>, and queries the
+ * kernel (`RtlGetVersion`, `ZwQueryValueKey`, `MmGetSystemRoutineAddress`)
+ * rather than going through user-mode modules.
+ *
+ * There's no CRT startup to hook in a driver, so `initialize()` should be
+ * called from `DriverEntry`, which in kernel mode loads the product info too.
+ * Checks before that load the version on first use. On Windows 10 and later
+ * that is read from `KUSER_SHARED_DATA`, which is safe at any IRQL, but older
+ * versions (or `WINDOWS_AVAILABILITY_NO_SHARED_USER_DATA`) fall back to
+ * `RtlGetVersion`, so the first check must then be made at `PASSIVE_LEVEL`.
+ * Everything else queries the kernel on first use, and so must also first be
+ * used at `PASSIVE_LEVEL`: checks for an update build revision (which read
+ * the registry), `productType()`, `isServer()`, `isWorkstation()` and
+ * `productEdition()` (unless `initialize()` has loaded them), and each
+ * `ApiFunction` (which uses `MmGetSystemRoutineAddress`).
+ */
+#ifdef WINDOWS_AVAILABILITY_KERNEL_MODE
+#if defined(WINDOWS_AVAILABILITY_EAGER_INIT)
+#error "WINDOWS_AVAILABILITY_EAGER_INIT is not supported in kernel mode, call initialize() from DriverEntry instead"
+#elif defined(WINDOWS_AVAILABILITY_DLL) || defined(WINDOWS_AVAILABILITY_TELEMETRY) || defined(WINDOWS_AVAILABILITY_ALLOW_OVERRIDE)
+#error "WINDOWS_AVAILABILITY_DLL, WINDOWS_AVAILABILITY_TELEMETRY and WINDOWS_AVAILABILITY_ALLOW_OVERRIDE are not supported in kernel mode"
+#elif defined(WINDOWS_AVAILABILITY_NO_WINDOWS_H)
+#error "WINDOWS_AVAILABILITY_NO_WINDOWS_H is not supported in kernel mode, which always includes <wdm.h>"
+#endif
+#endif
+
+/**
+ * With `WINDOWS_AVAILABILITY_MODULE` defined, this header imports the
+ * `windows_availability` module (built from `src/windows_availability.ixx`)
+ * and only defines the `__builtin_available` macros itself, since macros
+ * can't be exported from a module.
+ */
+#if defined(WINDOWS_AVAILABILITY_MODULE) && !defined(___WA_MODULE_INTERFACE)
+import windows_availability;
+#else
+
+#ifndef ___WA_EXPORT
+#define ___WA_EXPORT
+#endif
+
+#include <atomic>
 #include <cassert>
 #include <cstdint>
 #include <tuple>
 #include <string_view>
+#include <type_traits>
+#include <utility>
+
+#ifdef WINDOWS_AVAILABILITY_TELEMETRY
+#include <cstdlib>
+#include <string>
+#endif
+
+/**
+ * With `WINDOWS_AVAILABILITY_DLL` defined, the runtime lives in a DLL built
+ * from `src/windows_availability.cpp`, which queries the OS once for the
+ * whole process. Every other module still checks against its own cached
+ * copy (so a check is still a single load), which it takes from the DLL on
+ * first use. Every module (and the DLL itself) must be built with it defined.
+ * This implies `WINDOWS_AVAILABILITY_NO_WINDOWS_H`.
+ */
+#ifdef WINDOWS_AVAILABILITY_DLL
+#ifndef WINDOWS_AVAILABILITY_NO_WINDOWS_H
+#define WINDOWS_AVAILABILITY_NO_WINDOWS_H
+#endif
+
+#ifdef WINDOWS_AVAILABILITY_IMPLEMENTATION
+#define ___WA_API                               __declspec(dllexport)
+#define ___WA_SHARED(type, name)                __declspec(dllexport) type name{}
+#else
+#define ___WA_API                               __declspec(dllimport)
+#define ___WA_SHARED(type, name)                extern __declspec(dllimport) type name
+#define ___WA_DLL_CLIENT
+#endif
+#else
+#define ___WA_API
+#define ___WA_SHARED(type, name)                inline type name{}
+#endif
+
+/**
+ * With `WINDOWS_AVAILABILITY_NO_WINDOWS_H` defined, this header doesn't
+ * include <windows.h>, and the few functions that need it are only declared.
+ * They are defined out-of-line by compiling `src/windows_availability.cpp`
+ * once into the program (with the same configuration macros).
+ */
+#if defined(WINDOWS_AVAILABILITY_NO_WINDOWS_H) && !defined(WINDOWS_AVAILABILITY_IMPLEMENTATION)
+#define ___WA_HAS_RUNTIME                       0
+#else
+#define ___WA_HAS_RUNTIME                       1
+#endif
+
+#ifdef WINDOWS_AVAILABILITY_NO_WINDOWS_H
+#define ___WA_RUNTIME                           ___WA_API
+#else
+#define ___WA_RUNTIME                           inline
+#endif
 
+#if ___WA_HAS_RUNTIME
+#ifdef WINDOWS_AVAILABILITY_KERNEL_MODE
+#include <wdm.h>
+#else
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #include <tchar.h>
+#endif
+#endif
+
+// Where `KUSER_SHARED_DATA` is mapped, which differs between user and kernel
+// mode
+#ifdef WINDOWS_AVAILABILITY_KERNEL_MODE
+#define ___WA_SHARED_USER_DATA                  KI_USER_SHARED_DATA
+#else
+#define ___WA_SHARED_USER_DATA                  0x7FFE0000
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define ___WA_COLD                              __declspec(noinline)
+#elif defined(__GNUC__) || defined(__clang__)
+#define ___WA_COLD                              __attribute__((noinline, cold))
+#else
+#define ___WA_COLD
+#endif
+
+#if defined(__cpp_consteval) && __cpp_consteval >= 201811L
+#define ___WA_CONSTEVAL                         consteval
+#else
+#define ___WA_CONSTEVAL                         constexpr
+#endif
+
+// Class types as template arguments, which clang has supported since clang 12
+// but only reports through `__cpp_nontype_template_args` from clang 18
+#if defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L
+#define ___WA_HAS_CLASS_NTTP                    1
+#elif defined(__clang__) && __clang_major__ >= 12 && (__cplusplus > 201703L || (defined(_MSVC_LANG) && _MSVC_LANG > 201703L))
+#define ___WA_HAS_CLASS_NTTP                    1
+#else
+#define ___WA_HAS_CLASS_NTTP                    0
+#endif
+
+___WA_EXPORT namespace __builtin_availability {
+#if !___WA_HAS_RUNTIME || defined(WINDOWS_AVAILABILITY_KERNEL_MODE)
+    // The same type as DWORD from <windows.h>
+    typedef unsigned long DWORD;
+#endif
 
-namespace __builtin_availability {
     typedef std::tuple<DWORD, DWORD, DWORD> VersionTuple;
 
+    /**
+     * A version packed into a single integer as (major << 56 | minor << 48 |
+     * build << 24 | revision), so that versions can be compared with one
+     * unsigned comparison.
+     *
+     * The revision is the optional update build revision (UBR), i.e. "3570" in
+     * "10.0.19045.3570". The cached system version never includes it, and it
+     * is only looked up for requirements that have one.
+     */
+    typedef std::uint64_t PackedVersion;
+
     /**
      * Everything in this `detail` namespace should hopefully be evaluated at
      * compile-time.
@@ -47,15 +200,40 @@ namespace __builtin_availability {
          * Called with no arguments, returns a special "invalid" version.
          * Otherwise, it fills any missing numbers with 0.
          */
-        static inline constexpr VersionTuple makeVersion(DWORD M = static_cast<DWORD>(-1), DWORD m = 0, DWORD b = 0) {
+        inline constexpr VersionTuple makeVersion(DWORD M = static_cast<DWORD>(-1), DWORD m = 0, DWORD b = 0) {
             return std::tie(M, m, b);
         }
 
+        /**
+         * The bits of a PackedVersion holding the update build revision.
+         */
+        inline constexpr PackedVersion revisionMask = 0xFFFFFF;
+
+        /**
+         * Returns the packed form of the provided version numbers.
+         *
+         * Numbers too large to be packed (including those of the "invalid"
+         * version) give a value greater than any real version.
+         */
+        inline constexpr PackedVersion packVersion(DWORD M, DWORD m, DWORD b, DWORD r = 0) {
+            if (M > 0xFF || m > 0xFF || b > 0xFFFFFF || r > 0xFFFFFF)
+                return ~static_cast<PackedVersion>(0);
+
+            return (static_cast<PackedVersion>(M) << 56) | (static_cast<PackedVersion>(m) << 48) | (static_cast<PackedVersion>(b) << 24) | static_cast<PackedVersion>(r);
+        }
+
+        /**
+         * Returns the packed form of a version tuple.
+         */
+        inline constexpr PackedVersion packVersion(const VersionTuple& v) {
+            return packVersion(std::get<0>(v), std::get<1>(v), std::get<2>(v));
+        }
+
         /**
          * Returns whether the specified string is trying to check for a
          * Windows version (vs some other platform).
          */
-        static inline constexpr bool checkPlatform(std::string_view s) {
+        inline constexpr bool checkPlatform(std::string_view s) {
             using namespace std::literals::string_view_literals;
 
             return (s.compare(0, 8, "Windows "sv) == 0) || (s.compare(0, 8, "windows "sv) == 0);
@@ -71,16 +249,17 @@ namespace __builtin_availability {
          * argument.
          *
          * Stops when it reaches a character that is not in the range of [0-9].
-         * Returns a boolean whether a number was successfully parsed.
+         * Returns a boolean whether a number was successfully parsed, leaving
+         * the string untouched if not.
          */
-        static inline constexpr bool extractVersionNumber(std::string_view& s, DWORD& v) {
+        inline constexpr bool extractVersionNumber(std::string_view& s, DWORD& v) {
             if (s.empty())
                 return false;
 
             char c = s[0];
-            s = s.substr(1);
             if (c < '0' || c > '9')
                 return false;
+            s = s.substr(1);
             v = static_cast<DWORD>(c - '0');
 
             while (!s.empty()) {
@@ -95,197 +274,1703 @@ namespace __builtin_availability {
 
         }
 
+        /**
+         * Returns whether a character separates the parts of a version string.
+         */
+        inline constexpr bool isSeparator(char c) {
+            return c == '.' || c == '_' || c == ' ';
+        }
+
+        /**
+         * Returns the leading part of a string, up to (but not including) the
+         * first separator.
+         */
+        inline constexpr std::string_view leadingToken(std::string_view s) {
+            std::size_t len = 0;
+            while (len < s.size() && !isSeparator(s[len]))
+                len++;
+
+            return s.substr(0, len);
+        }
+
+        /**
+         * A Windows product name (the part after "Windows ") whose version
+         * numbers don't match its name.
+         */
+        struct ProductName {
+            std::string_view name;
+            DWORD major;
+            DWORD minor;
+            DWORD build;
+        };
+
+        /**
+         * A named release of a Windows product, such as "22H2" for Windows 10.
+         */
+        struct ReleaseName {
+            std::string_view product;
+            std::string_view name;
+            DWORD major;
+            DWORD minor;
+            DWORD build;
+        };
+
+        /**
+         * Known product names, which must be kept sorted by name.
+         */
+        inline constexpr ProductName productNames[] = {
+            { "11",     10, 0, 22000 },
+            { "7",      6,  1, 0     },
+            { "8",      6,  2, 0     },
+            // Server versions can only be named by release, so this is left
+            // invalid unless there's a matching entry in `releaseNames`
+            { "Server", static_cast<DWORD>(-1), 0, 0 },
+            { "Vista",  6,  0, 0     },
+            { "XP",     5,  1, 0     },
+            { "vista",  6,  0, 0     },
+            { "xp",     5,  1, 0     },
+        };
+
+        /**
+         * Known release names, which must be kept sorted by product and then
+         * name.
+         */
+        inline constexpr ReleaseName releaseNames[] = {
+            { "10", "1507", 10, 0, 10240 },
+            { "10", "1511", 10, 0, 10586 },
+            { "10", "1607", 10, 0, 14393 },
+            { "10", "1703", 10, 0, 15063 },
+            { "10", "1709", 10, 0, 16299 },
+            { "10", "1803", 10, 0, 17134 },
+            { "10", "1809", 10, 0, 17763 },
+            { "10", "1903", 10, 0, 18362 },
+            { "10", "1909", 10, 0, 18363 },
+            { "10", "2004", 10, 0, 19041 },
+            { "10", "20H2", 10, 0, 19042 },
+            { "10", "21H1", 10, 0, 19043 },
+            { "10", "21H2", 10, 0, 19044 },
+            { "10", "22H2", 10, 0, 19045 },
+            { "11", "21H2", 10, 0, 22000 },
+            { "11", "22H2", 10, 0, 22621 },
+            { "11", "23H2", 10, 0, 22631 },
+            { "11", "24H2", 10, 0, 26100 },
+            { "11", "25H2", 10, 0, 26200 },
+            { "8",  "1",    6,  3, 0     },
+            { "Server", "2003",     5,  2, 3790  },
+            { "Server", "2003 R2",  5,  2, 3790  },
+            { "Server", "2008",     6,  0, 6001  },
+            { "Server", "2008 R2",  6,  1, 7600  },
+            { "Server", "2012",     6,  2, 9200  },
+            { "Server", "2012 R2",  6,  3, 9600  },
+            { "Server", "2016",     10, 0, 14393 },
+            { "Server", "2019",     10, 0, 17763 },
+            { "Server", "2022",     10, 0, 20348 },
+            { "Server", "2025",     10, 0, 26100 },
+        };
+
+        inline constexpr bool lessThan(const ProductName& a, const ProductName& b) {
+            return a.name < b.name;
+        }
+
+        inline constexpr bool lessThan(const ReleaseName& a, const ReleaseName& b) {
+            return a.product < b.product || (a.product == b.product && a.name < b.name);
+        }
+
+        /**
+         * Returns whether a table is sorted, so that it can be searched with
+         * `findEntry`.
+         */
+        template <typename T, std::size_t N>
+        inline constexpr bool isSorted(const T (&table)[N]) {
+            for (std::size_t i = 1; i < N; i++) {
+                if (!lessThan(table[i - 1], table[i]))
+                    return false;
+            }
+
+            return true;
+        }
+
+        static_assert(isSorted(productNames), "productNames must be sorted by name");
+        static_assert(isSorted(releaseNames), "releaseNames must be sorted by product and name");
+
+        /**
+         * Binary searches a sorted table for an entry equal to `key`, so the
+         * compile-time cost of a lookup stays flat as the table grows.
+         *
+         * Returns a pointer to the entry, or nullptr if there isn't one.
+         */
+        template <typename T, std::size_t N>
+        inline constexpr const T* findEntry(const T (&table)[N], const T& key) {
+            std::size_t first = 0;
+            std::size_t count = N;
+
+            while (count > 0) {
+                std::size_t step = count / 2;
+                if (lessThan(table[first + step], key)) {
+                    first += step + 1;
+                    count -= step + 1;
+                } else {
+                    count = step;
+                }
+            }
+
+            if (first == N || lessThan(key, table[first]))
+                return nullptr;
+
+            return &table[first];
+        }
+
         /**
          * Parses the Windows version number out of a string such as "Windows
          * 10 21H2" and returns a VersionTuple for comparison against the
          * system version.
          *
          * Most of the complexity here is around handling Microsoft's
-         * non-sequential numbering and naming of versions.
+         * non-sequential numbering and naming of versions, which is kept in
+         * the `productNames` and `releaseNames` tables. Supporting a new
+         * release should only need a new entry in `releaseNames`.
          *
-         * Currently this *only* supports common consumer versions of Windows
-         * (not server versions). If you need to compare against a server
-         * version, it will work if you provide the full build number directly
-         * rather than a name (i.e., "Windows 6.0.6003" instead of "Windows
-         * Server 2008 SP2").
+         * Server versions are supported by release name (i.e., "Windows
+         * Server 2019" or "Windows Server 2008 R2"). Like every other check,
+         * these only compare the version number, so a client OS with the same
+         * build passes too; use `isServer()` to check the product type. For
+         * anything else, provide the full build number directly rather than a
+         * name (i.e., "Windows 6.0.6003" instead of "Windows Server 2008 SP2").
+         *
+         * If the string ends with an update build revision (i.e., "Windows
+         * 10.0.19045.3570" or "Windows 10 22H2.3570"), it is stored in
+         * `revision`.
          *
          * Returns an "invalid" VersionTuple (that won't match anything) if it
          * fails to parse the string.
+         *
+         * This advances `s` past the characters that were parsed, so anything
+         * left over wasn't understood.
          */
-        static inline constexpr VersionTuple parseWindowsVersion(std::string_view s) {
-            using namespace std::literals::string_view_literals;
-
-            // The parsed major version, which rarely aligns with the actual OS
-            // major version, so we need to keep track of this for further
-            // handling of not-so-special cases
-            DWORD reqMajor = 0;
-
+        inline constexpr VersionTuple consumeWindowsVersion(std::string_view& s, DWORD& revision) {
             DWORD major = 0;
             DWORD minor = 0;
             DWORD build = 0;
 
             s = s.substr(8); // Strip off "Windows "
 
-            if (s.compare(0, 5, "Vista"sv) == 0 || s.compare(0, 5, "vista"sv) == 0) {
-                reqMajor = 6;
-            } else if (s.compare(0, 2, "XP"sv) == 0 || s.compare(0, 2, "xp"sv) == 0) {
-                reqMajor = 5;
-                minor = 1;
-            } else if (!extractVersionNumber(s, reqMajor)) {
+            // The product name, which rarely aligns with the actual OS
+            // version, so we need to keep track of this for looking up
+            // release names
+            std::string_view product = leadingToken(s);
+
+            if (const ProductName* entry = findEntry(productNames, ProductName{ product, 0, 0, 0 })) {
+                major = entry->major;
+                minor = entry->minor;
+                build = entry->build;
+                s = s.substr(product.size());
+            } else if (!extractVersionNumber(s, major)) {
                 // Failed to parse
                 return makeVersion();
             }
 
-            major = reqMajor;
+            if (s.empty() || !isSeparator(s[0]))
+                return makeVersion(major, minor, build);
+
+            s = s.substr(1);
+
+            std::string_view release = leadingToken(s);
 
-            // Windows 7
-            if (reqMajor == 7) {
-                major = 6;
-                minor = 1;
+            // Some release names are two words, i.e. "2008 R2"
+            if (release.size() < s.size()) {
+                std::string_view longRelease = s.substr(0, release.size() + 1 + leadingToken(s.substr(release.size() + 1)).size());
+                if (findEntry(releaseNames, ReleaseName{ product, longRelease, 0, 0, 0 }))
+                    release = longRelease;
             }
 
-            // Windows 8
-            if (reqMajor == 8) {
-                major = 6;
-                minor = 2;
+            // Whether the build number is already known, so the next number
+            // would be the update build revision
+            bool hasBuild = false;
+
+            if (const ReleaseName* entry = findEntry(releaseNames, ReleaseName{ product, release, 0, 0, 0 })) {
+                major = entry->major;
+                minor = entry->minor;
+                build = entry->build;
+                hasBuild = (build != 0);
+                s = s.substr(release.size());
+            } else if (!extractVersionNumber(s, minor)) {
+                return makeVersion(major, minor, build);
+            } else if (major == 10 && minor > 0) {
+                // If we parsed a minor version on Windows 10 & 11, it's
+                // probably actually the build number
+                build = minor;
+                minor = 0;
+                hasBuild = true;
             }
 
-            // Windows 11
-            if (reqMajor == 11) {
-                major = 10;
-                build = 22000;
+            if (!hasBuild) {
+                if (s.empty() || !isSeparator(s[0]))
+                    return makeVersion(major, minor, build);
+
+                s = s.substr(1);
+
+                if (!extractVersionNumber(s, build))
+                    return makeVersion(major, minor, build);
             }
 
-            if (s.empty() || (s[0] != '.' && s[0] != '_' && s[0] != ' '))
+            if (s.empty() || !isSeparator(s[0]))
                 return makeVersion(major, minor, build);
 
             s = s.substr(1);
 
-            // Windows 10 & 11 named updates
-            if (reqMajor == 11 && s.compare(0, 4, "22H2"sv) == 0) {
-                build = 22621;
-            } else if (reqMajor == 11 && s.compare(0, 4, "21H2"sv) == 0) {
-                build = 22000;
-            } else if (reqMajor == 10 && s.compare(0, 4, "22H2"sv) == 0) {
-                build = 19045;
-            } else if (reqMajor == 10 && s.compare(0, 4, "21H2"sv) == 0) {
-                build = 19044;
-            } else if (reqMajor == 10 && s.compare(0, 4, "21H1"sv) == 0) {
-                build = 19043;
-            } else if (reqMajor == 10 && s.compare(0, 4, "20H2"sv) == 0) {
-                build = 19042;
-            } else if (!extractVersionNumber(s, minor)) {
-                return makeVersion(major, minor, build);
+            extractVersionNumber(s, revision);
+
+            return makeVersion(major, minor, build);
+        }
+
+        inline constexpr VersionTuple parseWindowsVersion(std::string_view s, DWORD& revision) {
+            return consumeWindowsVersion(s, revision);
+        }
+
+        inline constexpr VersionTuple parseWindowsVersion(std::string_view s) {
+            DWORD revision = 0;
+            return consumeWindowsVersion(s, revision);
+        }
+
+        /**
+         * The packed form of the "invalid" version.
+         */
+        inline constexpr PackedVersion invalidVersion = packVersion(makeVersion());
+
+        /**
+         * Returns the packed version required by the comma-separated
+         * arguments of a `__builtin_available` check, such as "Windows 10
+         * 1809, Windows 11 22H2, macOS 10.15".
+         *
+         * The check passes if any one of the alternatives does, which is the
+         * same as requiring the lowest of them, so any number of alternatives
+         * reduce to a single comparison. Arguments for other platforms (i.e.,
+         * "macOS 10.15" or "*") are ignored, and if there are no Windows
+         * alternatives this returns the "invalid" version.
+         *
+         * This is `consteval` where supported to guarantee that no part of the
+         * parsing is ever left to runtime, even in unoptimized builds.
+         */
+        inline ___WA_CONSTEVAL PackedVersion requiredVersion(std::string_view s) {
+            PackedVersion required = invalidVersion;
+
+            while (!s.empty()) {
+                std::size_t end = s.find(',');
+                std::string_view alternative = s.substr(0, end);
+                s = (end == std::string_view::npos) ? std::string_view() : s.substr(end + 1);
+
+                while (!alternative.empty() && alternative[0] == ' ')
+                    alternative = alternative.substr(1);
+
+                if (!checkPlatform(alternative))
+                    continue;
+
+                DWORD revision = 0;
+                VersionTuple parsed = parseWindowsVersion(alternative, revision);
+
+                PackedVersion version = packVersion(std::get<0>(parsed), std::get<1>(parsed), std::get<2>(parsed), revision);
+                if (version < required)
+                    required = version;
             }
 
-            // Windows 8.1
-            if (reqMajor == 8 && minor == 1) {
-                minor = 3;
+            return required;
+        }
+
+        /**
+         * Returns whether every Windows alternative in the arguments of a
+         * `__builtin_available` check is a valid version with nothing left
+         * over, i.e. that "Windows 10 21h2" (with a lowercase "h") isn't
+         * silently treated as a build number followed by junk.
+         */
+        inline ___WA_CONSTEVAL bool isValidRequirement(std::string_view s) {
+            while (!s.empty()) {
+                std::size_t end = s.find(',');
+                std::string_view alternative = s.substr(0, end);
+                s = (end == std::string_view::npos) ? std::string_view() : s.substr(end + 1);
+
+                while (!alternative.empty() && alternative[0] == ' ')
+                    alternative = alternative.substr(1);
+
+                if (!checkPlatform(alternative))
+                    continue;
+
+                DWORD revision = 0;
+                VersionTuple parsed = consumeWindowsVersion(alternative, revision);
+
+                if (!alternative.empty() || packVersion(std::get<0>(parsed), std::get<1>(parsed), std::get<2>(parsed), revision) == invalidVersion)
+                    return false;
             }
 
-            // Windows 10 & 11
-            if (major == 10 && minor > 0) {
-                // If we parsed a minor version, it's probably actually the build number
-                // Again, need to deal with user-facing names of Windows 10 updates
-                if (reqMajor == 10 && minor == 2004) {
-                    build = 19041;
-                } else if (reqMajor == 10 && minor == 1909) {
-                    build = 18363;
-                } else if (reqMajor == 10 && minor == 1903) {
-                    build = 18362;
-                } else if (reqMajor == 10 && minor == 1809) {
-                    build = 17763;
-                } else if (reqMajor == 10 && minor == 1803) {
-                    build = 17134;
-                } else if (reqMajor == 10 && minor == 1709) {
-                    build = 16299;
-                } else if (reqMajor == 10 && minor == 1703) {
-                    build = 15063;
-                } else if (reqMajor == 10 && minor == 1607) {
-                    build = 14393;
-                } else if (reqMajor == 10 && minor == 1511) {
-                    build = 10586;
-                } else if (reqMajor == 10 && minor == 1507) {
-                    build = 10240;
-                } else {
-                    build = minor;
-                }
-                minor = 0;
+            return true;
+        }
+
+        /**
+         * The required version of a check made with
+         * `WINDOWS_AVAILABILITY_STRICT` defined, which fails to compile if
+         * the version string wasn't valid.
+         */
+        template <bool valid, PackedVersion version>
+        struct StrictVersion {
+            static_assert(valid, "__builtin_available has an invalid or misspelled Windows version");
+
+            static constexpr PackedVersion value = version;
+        };
+
+#ifdef WINDOWS_AVAILABILITY_STRICT
+        // Deliberately not constexpr, so that reaching it during constant
+        // evaluation fails to compile
+        inline void invalidWindowsVersionInStrictMode() { }
+#endif
+
+        /**
+         * The same as `requiredVersion`, but with `WINDOWS_AVAILABILITY_STRICT`
+         * defined it fails to compile for a string that isn't valid.
+         */
+        inline ___WA_CONSTEVAL PackedVersion checkedRequiredVersion(std::string_view s) {
+#ifdef WINDOWS_AVAILABILITY_STRICT
+            if (!isValidRequirement(s))
+                invalidWindowsVersionInStrictMode();
+#endif
+            return requiredVersion(s);
+        }
+
+#if ___WA_HAS_CLASS_NTTP
+        /**
+         * A string literal that can be used as a template argument.
+         */
+        template <std::size_t N>
+        struct FixedString {
+            char value[N];
+
+            constexpr FixedString(const char (&s)[N]) : value() {
+                for (std::size_t i = 0; i < N; i++)
+                    value[i] = s[i];
             }
 
-            if (s.empty() || (s[0] != '.' && s[0] != '_' && s[0] != ' '))
-                return makeVersion(major, minor, build);
+            constexpr std::string_view view() const {
+                return std::string_view(value, N - 1);
+            }
+        };
+#endif
+    }
 
-            s = s.substr(1);
 
-            if (!extractVersionNumber(s, build))
-                return makeVersion(major, minor, build);
+    /**
+     * The minimum version of Windows that the code is built to run on, set by
+     * defining `WINDOWS_AVAILABILITY_MIN_TARGET` to a string such as "Windows
+     * 10 1809".
+     *
+     * Checks for versions at or below this are always true, and are resolved
+     * at compile-time without looking at the system version at all.
+     */
+#ifdef WINDOWS_AVAILABILITY_MIN_TARGET
+    inline constexpr PackedVersion minimumTargetVersion = detail::requiredVersion(WINDOWS_AVAILABILITY_MIN_TARGET);
 
-            return makeVersion(major, minor, build);
+    static_assert(minimumTargetVersion != detail::invalidVersion && detail::isValidRequirement(WINDOWS_AVAILABILITY_MIN_TARGET), "WINDOWS_AVAILABILITY_MIN_TARGET is not a valid Windows version");
+#else
+    inline constexpr PackedVersion minimumTargetVersion = 0;
+#endif
+
+    /**
+     * A Windows version as a literal type, usually written as "Windows 10
+     * 2004"_winver.
+     *
+     * In C++20 this can be used as a template argument, i.e. to specialize
+     * `template <WindowsVersion V>` implementations, or to choose between
+     * them with `if constexpr` against `minimumTarget`.
+     */
+    struct WindowsVersion {
+        PackedVersion packed;
+
+        /**
+         * Returns whether this is a real version, rather than one that failed
+         * to parse (or was for another platform).
+         */
+        constexpr bool isValid() const {
+            return packed != detail::invalidVersion;
+        }
+
+        friend constexpr bool operator==(WindowsVersion a, WindowsVersion b) { return a.packed == b.packed; }
+        friend constexpr bool operator!=(WindowsVersion a, WindowsVersion b) { return a.packed != b.packed; }
+        friend constexpr bool operator<(WindowsVersion a, WindowsVersion b) { return a.packed < b.packed; }
+        friend constexpr bool operator<=(WindowsVersion a, WindowsVersion b) { return a.packed <= b.packed; }
+        friend constexpr bool operator>(WindowsVersion a, WindowsVersion b) { return a.packed > b.packed; }
+        friend constexpr bool operator>=(WindowsVersion a, WindowsVersion b) { return a.packed >= b.packed; }
+    };
+
+    /**
+     * The minimum target version (see `WINDOWS_AVAILABILITY_MIN_TARGET`), so
+     * that `if constexpr (minimumTarget >= "Windows 10 2004"_winver)` can
+     * select code paths that are guaranteed to be supported.
+     */
+    inline constexpr WindowsVersion minimumTarget{ minimumTargetVersion };
+
+    inline namespace literals {
+        /**
+         * Parses a version string, such as "Windows 10 2004"_winver, into a
+         * WindowsVersion at compile-time.
+         */
+        inline ___WA_CONSTEVAL WindowsVersion operator""_winver(const char* s, std::size_t len) {
+            return WindowsVersion{ detail::checkedRequiredVersion(std::string_view(s, len)) };
         }
     }
 
+    /**
+     * The current OS version, in packed form. Zero until it has been loaded.
+     *
+     * This (and the functions that manage it) has external linkage, so there
+     * is a single copy shared by every translation unit in a module.
+     *
+     * The whole version is published with a single atomic store, so a thread
+     * can never observe a partially initialized version.
+     */
+    inline std::atomic<PackedVersion> systemVersion{0};
+
+    /**
+     * The update build revision of the OS, plus one so that zero means it
+     * hasn't been loaded yet. This is only loaded when checking a requirement
+     * that includes a revision.
+     */
+    inline std::atomic<PackedVersion> updateRevision{0};
+
+#ifdef WINDOWS_AVAILABILITY_DLL
+    /**
+     * Exported by the `WINDOWS_AVAILABILITY_DLL` runtime, returning its own
+     * cached values (loading them first if needed), which every other module
+     * copies into its own cache on first use.
+     */
+    ___WA_API PackedVersion _providerSystemVersion();
+    ___WA_API PackedVersion _providerUpdateRevision();
+    ___WA_API std::uint64_t _providerProductInfo();
+#endif
+
+    /**
+     * Reads the OS version directly from the `KUSER_SHARED_DATA` page that
+     * the kernel maps at a fixed address into every process (and into the
+     * kernel's own address space).
+     *
+     * This takes no calls and never touches the loader, so it is safe from
+     * TLS callbacks and `DllMain`. The build number is only present in the
+     * shared page from Windows 10 onwards, so this returns 0 on older versions.
+     *
+     * Defining `WINDOWS_AVAILABILITY_NO_SHARED_USER_DATA` disables this.
+     */
+    inline PackedVersion _readSharedUserData() {
+#ifdef WINDOWS_AVAILABILITY_NO_SHARED_USER_DATA
+        return 0;
+#else
+        constexpr std::uintptr_t sharedUserData = ___WA_SHARED_USER_DATA;
+        constexpr std::uintptr_t ntBuildNumberOffset = 0x260;
+        constexpr std::uintptr_t ntMajorVersionOffset = 0x26C;
+        constexpr std::uintptr_t ntMinorVersionOffset = 0x270;
+
+        DWORD majorVersion = *reinterpret_cast<const volatile DWORD*>(sharedUserData + ntMajorVersionOffset);
+        DWORD minorVersion = *reinterpret_cast<const volatile DWORD*>(sharedUserData + ntMinorVersionOffset);
+        DWORD buildVersion = *reinterpret_cast<const volatile DWORD*>(sharedUserData + ntBuildNumberOffset) & 0x0FFFFFFF;
 
-    static inline DWORD majorVersion = 0;
-    static inline DWORD minorVersion = 0;
-    static inline DWORD buildVersion = 0;
+        if (majorVersion < 10 || !buildVersion)
+            return 0;
+
+        return detail::packVersion(majorVersion, minorVersion, buildVersion);
+#endif
+    }
 
     /**
-     * Should be called once, automatically, at runtime, to initialize the static version numbers with the current OS value.
+     * Asks ntdll for the OS version, which works on every version of Windows
+     * but needs the loader to find `RtlGetNtVersionNumbers`. In kernel mode,
+     * this asks the kernel with `RtlGetVersion` instead, which can only be
+     * called at `PASSIVE_LEVEL`.
      */
-    static inline void _loadSystemVersion() {
+    ___WA_RUNTIME PackedVersion _querySystemVersion();
+
+#if ___WA_HAS_RUNTIME && defined(WINDOWS_AVAILABILITY_KERNEL_MODE)
+    ___WA_RUNTIME PackedVersion _querySystemVersion() {
+        RTL_OSVERSIONINFOW info = {};
+        info.dwOSVersionInfoSize = sizeof(info);
+
+        // Always succeeds for RTL_OSVERSIONINFOW
+        RtlGetVersion(&info);
+
+        return detail::packVersion(info.dwMajorVersion, info.dwMinorVersion, info.dwBuildNumber & 0x0FFFFFFF);
+    }
+#elif ___WA_HAS_RUNTIME
+    ___WA_RUNTIME PackedVersion _querySystemVersion() {
         typedef void (WINAPI *RtlGetNtVersionNumbersPtrType)(LPDWORD, LPDWORD, LPDWORD);
 
         HINSTANCE inst = GetModuleHandle(_T("ntdll.dll"));
-        RtlGetNtVersionNumbersPtrType RtlGetNtVersionNumbers = reinterpret_cast<RtlGetNtVersionNumbersPtrType>(GetProcAddress(inst, "RtlGetNtVersionNumbers"));
+        RtlGetNtVersionNumbersPtrType RtlGetNtVersionNumbers = reinterpret_cast<RtlGetNtVersionNumbersPtrType>(reinterpret_cast<void*>(GetProcAddress(inst, "RtlGetNtVersionNumbers")));
 
         assert(RtlGetNtVersionNumbers);
 
+        DWORD majorVersion = 0;
+        DWORD minorVersion = 0;
+        DWORD buildVersion = 0;
+
         RtlGetNtVersionNumbers(&majorVersion, &minorVersion, &buildVersion);
         buildVersion &= 0x0FFFFFFF;
+
+        return detail::packVersion(majorVersion, minorVersion, buildVersion);
     }
+#endif
 
     /**
-     * The version comparison function, checking if the requested version is supported by the current OS.
-     *
-     * Called at runtime whenever a `__builtin_available(Windows ...)` block is encountered.
+     * Reads the update build revision (UBR) of the OS from the registry,
+     * returning 0 if there isn't one.
      */
-    static inline bool _isVersionAtLeast(const VersionTuple& version) {
-        if (!majorVersion)
-            _loadSystemVersion();
+    ___WA_RUNTIME DWORD _queryUpdateRevision();
+
+#if ___WA_HAS_RUNTIME && defined(WINDOWS_AVAILABILITY_KERNEL_MODE)
+    ___WA_RUNTIME DWORD _queryUpdateRevision() {
+        UNICODE_STRING keyName = RTL_CONSTANT_STRING(L"\\Registry\\Machine\\SOFTWARE\\Microsoft\\Windows NT\\CurrentVersion");
+        OBJECT_ATTRIBUTES attributes;
+        InitializeObjectAttributes(&attributes, &keyName, OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE, nullptr, nullptr);
+
+        HANDLE key = nullptr;
+        if (!NT_SUCCESS(ZwOpenKey(&key, KEY_QUERY_VALUE, &attributes)))
+            return 0;
+
+        UNICODE_STRING valueName = RTL_CONSTANT_STRING(L"UBR");
+        union {
+            KEY_VALUE_PARTIAL_INFORMATION info;
+            UCHAR buffer[sizeof(KEY_VALUE_PARTIAL_INFORMATION) + sizeof(ULONG)];
+        } value;
+        ULONG size = 0;
+
+        DWORD revision = 0;
+        if (NT_SUCCESS(ZwQueryValueKey(key, &valueName, KeyValuePartialInformation, &value, sizeof(value), &size)) && value.info.Type == REG_DWORD && value.info.DataLength == sizeof(ULONG))
+            revision = *reinterpret_cast<const ULONG*>(value.info.Data);
 
-        return version <= std::tie(majorVersion, minorVersion, buildVersion);
+        ZwClose(key);
+        return revision;
     }
-}
+#elif ___WA_HAS_RUNTIME
+#ifdef _MSC_VER
+#pragma comment(lib, "advapi32.lib")
+#endif
 
-#define ___windows_available_check(x) ([]{ \
-    if constexpr (__builtin_availability::detail::checkPlatform(x)) { \
-        return __builtin_availability::_isVersionAtLeast(__builtin_availability::detail::parseWindowsVersion(x)); \
-    } else { \
-        return false; \
-    } }())
-
-#define ___wa_select(a1, a2, a3, a4, a5, a6, ...)   a6
-#define ___wa_num(...)                          ___wa_select(__VA_ARGS__, 5, 4, 3, 2, 1, 0)
-#define ___windows_available_helper_5(x, ...)   ___windows_available_check(#x) || ___windows_available_helper_4(__VA_ARGS__)
-#define ___windows_available_helper_4(x, ...)   ___windows_available_check(#x) || ___windows_available_helper_3(__VA_ARGS__)
-#define ___windows_available_helper_3(x, ...)   ___windows_available_check(#x) || ___windows_available_helper_2(__VA_ARGS__)
-#define ___windows_available_helper_2(x, ...)   ___windows_available_check(#x) || ___windows_available_helper_1(__VA_ARGS__)
-#define ___windows_available_helper_1(x)        ___windows_available_check(#x)
-#define ___windows_available_macro2(c, ...)     ___windows_available_helper_##c(__VA_ARGS__)
-#define ___windows_available_macro1(c, ...)     ___windows_available_macro2(c, __VA_ARGS__)
-#define ___windows_available(...)               ___windows_available_macro1(___wa_num(__VA_ARGS__), __VA_ARGS__)
+    ___WA_RUNTIME DWORD _queryUpdateRevision() {
+        HKEY key = nullptr;
+        if (RegOpenKeyExW(HKEY_LOCAL_MACHINE, L"SOFTWARE\\Microsoft\\Windows NT\\CurrentVersion", 0, KEY_QUERY_VALUE | KEY_WOW64_64KEY, &key) != ERROR_SUCCESS)
+            return 0;
 
-#define windows_version_available               ___windows_available
-#define windows_version(...)                    __VA_ARGS__
+        DWORD revision = 0;
+        DWORD type = 0;
+        DWORD size = sizeof(revision);
 
-#ifndef NO_BUILTIN_AVAILABLE_CLOBBER
-#define __builtin_available                     ___windows_available
+        if (RegQueryValueExW(key, L"UBR", nullptr, &type, reinterpret_cast<LPBYTE>(&revision), &size) != ERROR_SUCCESS || type != REG_DWORD)
+            revision = 0;
+
+        RegCloseKey(key);
+        return revision;
+    }
+#endif
+
+    /**
+     * Asks ntdll for the product type (one of the `VER_NT_*` values), for
+     * when it isn't available from the shared user data page.
+     */
+    ___WA_RUNTIME DWORD _queryProductType();
+
+    /**
+     * Returns the edition of the OS (one of the `PRODUCT_*` values from
+     * `GetProductInfo`), or 0 if it can't be determined.
+     */
+    ___WA_RUNTIME DWORD _queryProductEdition(PackedVersion version);
+
+#if ___WA_HAS_RUNTIME && defined(WINDOWS_AVAILABILITY_KERNEL_MODE)
+    ___WA_RUNTIME DWORD _queryProductType() {
+        RTL_OSVERSIONINFOEXW info = {};
+        info.dwOSVersionInfoSize = sizeof(info);
+
+        if (!NT_SUCCESS(RtlGetVersion(reinterpret_cast<PRTL_OSVERSIONINFOW>(&info))))
+            return 0;
+
+        return info.wProductType;
+    }
+
+    ___WA_RUNTIME DWORD _queryProductEdition(PackedVersion version) {
+        typedef BOOLEAN (NTAPI *RtlGetProductInfoPtrType)(ULONG, ULONG, ULONG, ULONG, PULONG);
+
+        // Not declared by the WDK, so it has to be looked up
+        UNICODE_STRING routineName = RTL_CONSTANT_STRING(L"RtlGetProductInfo");
+        RtlGetProductInfoPtrType RtlGetProductInfo = reinterpret_cast<RtlGetProductInfoPtrType>(MmGetSystemRoutineAddress(&routineName));
+
+        ULONG edition = 0;
+        if (!RtlGetProductInfo || !RtlGetProductInfo(static_cast<ULONG>(version >> 56), static_cast<ULONG>((version >> 48) & 0xFF), 0, 0, &edition))
+            return 0;
+
+        return edition;
+    }
+#elif ___WA_HAS_RUNTIME
+    ___WA_RUNTIME DWORD _queryProductType() {
+        typedef BOOLEAN (WINAPI *RtlGetNtProductTypePtrType)(PDWORD);
+
+        HINSTANCE inst = GetModuleHandleW(L"ntdll.dll");
+        RtlGetNtProductTypePtrType RtlGetNtProductType = reinterpret_cast<RtlGetNtProductTypePtrType>(reinterpret_cast<void*>(GetProcAddress(inst, "RtlGetNtProductType")));
+
+        DWORD type = 0;
+        if (!RtlGetNtProductType || !RtlGetNtProductType(&type))
+            return 0;
+
+        return type;
+    }
+
+    ___WA_RUNTIME DWORD _queryProductEdition(PackedVersion version) {
+        typedef BOOL (WINAPI *GetProductInfoPtrType)(DWORD, DWORD, DWORD, DWORD, PDWORD);
+
+        // Only available from Windows Vista, so it has to be looked up
+        HINSTANCE inst = GetModuleHandleW(L"kernel32.dll");
+        GetProductInfoPtrType GetProductInfo = reinterpret_cast<GetProductInfoPtrType>(reinterpret_cast<void*>(GetProcAddress(inst, "GetProductInfo")));
+
+        DWORD edition = 0;
+        if (!GetProductInfo || !GetProductInfo(static_cast<DWORD>(version >> 56), static_cast<DWORD>((version >> 48) & 0xFF), 0, 0, &edition))
+            return 0;
+
+        return edition;
+    }
+#endif
+
+    /**
+     * Looks up an exported function from an already loaded module, returning
+     * nullptr if either the module or the function can't be found.
+     */
+    ___WA_RUNTIME void* _resolveProcAddress(const wchar_t* moduleName, const char* procName);
+
+#if ___WA_HAS_RUNTIME && defined(WINDOWS_AVAILABILITY_KERNEL_MODE)
+    ___WA_RUNTIME void* _resolveProcAddress(const wchar_t* moduleName, const char* procName) {
+        // Only exports of the kernel and the HAL can be looked up from a
+        // driver, so the module is ignored
+        static_cast<void>(moduleName);
+
+        wchar_t name[128];
+        std::size_t length = 0;
+        for (; procName[length]; length++) {
+            if (length + 1 >= sizeof(name) / sizeof(name[0]))
+                return nullptr;
+            name[length] = static_cast<wchar_t>(procName[length]);
+        }
+        name[length] = L'\0';
+
+        UNICODE_STRING routineName;
+        RtlInitUnicodeString(&routineName, name);
+        return MmGetSystemRoutineAddress(&routineName);
+    }
+#elif ___WA_HAS_RUNTIME
+    ___WA_RUNTIME void* _resolveProcAddress(const wchar_t* moduleName, const char* procName) {
+        HMODULE inst = GetModuleHandleW(moduleName);
+        if (!inst)
+            return nullptr;
+
+        return reinterpret_cast<void*>(GetProcAddress(inst, procName));
+    }
+#endif
+
+    /**
+     * Replaces the system version for the rest of the process, i.e. to test
+     * the fallback paths of `__builtin_available` checks on a newer OS. The
+     * revision of `version` (if any) replaces the update build revision too.
+     *
+     * This must be called before the first check (and so can't be used with
+     * `WINDOWS_AVAILABILITY_EAGER_INIT`). Returns false if the system version
+     * had already been loaded, in which case nothing changes.
+     *
+     * With `WINDOWS_AVAILABILITY_DLL`, this only affects the calling module;
+     * the `WINDOWS_AVAILABILITY_OVERRIDE` environment variable overrides the
+     * version for every module.
+     */
+    inline bool overrideSystemVersion(WindowsVersion version) {
+        // Zero would look like the version hasn't been loaded
+        if (!version.isValid() || !(version.packed & ~detail::revisionMask))
+            return false;
+
+        PackedVersion packed = version.packed & ~detail::revisionMask;
+        PackedVersion revision = (version.packed & detail::revisionMask) + 1;
+
+        // The revision has to be in place before the version is published, or
+        // a check that sees the version could load the real revision instead
+        PackedVersion previousRevision = updateRevision.exchange(revision, std::memory_order_release);
+
+        PackedVersion expected = 0;
+        if (!systemVersion.compare_exchange_strong(expected, packed, std::memory_order_release, std::memory_order_acquire)) {
+            // Lost to the real version, so put back whatever revision it had
+            if (expected != packed)
+                updateRevision.compare_exchange_strong(revision, previousRevision, std::memory_order_release, std::memory_order_relaxed);
+
+            return false;
+        }
+
+        return true;
+    }
+
+#ifdef WINDOWS_AVAILABILITY_ALLOW_OVERRIDE
+    /**
+     * Reads a version override from the `WINDOWS_AVAILABILITY_OVERRIDE`
+     * environment variable, returning 0 if it isn't set or isn't a valid
+     * version. The value is a version string without the leading "Windows",
+     * i.e. "10.0.17763" or "10 1809".
+     *
+     * This is only compiled with `WINDOWS_AVAILABILITY_ALLOW_OVERRIDE`
+     * defined, so that production builds can't be redirected by the
+     * environment.
+     */
+    ___WA_RUNTIME PackedVersion _queryOverrideVersion();
+
+#if ___WA_HAS_RUNTIME
+    ___WA_RUNTIME PackedVersion _queryOverrideVersion() {
+        constexpr std::size_t prefixLength = 8;
+
+        char buffer[64] = "Windows ";
+        DWORD length = GetEnvironmentVariableA("WINDOWS_AVAILABILITY_OVERRIDE", buffer + prefixLength, sizeof(buffer) - prefixLength);
+        if (length == 0 || length >= sizeof(buffer) - prefixLength)
+            return 0;
+
+        DWORD revision = 0;
+        VersionTuple parsed = detail::parseWindowsVersion(std::string_view(buffer, prefixLength + length), revision);
+
+        PackedVersion version = detail::packVersion(std::get<0>(parsed), std::get<1>(parsed), std::get<2>(parsed), revision);
+        if (version == detail::invalidVersion)
+            return 0;
+
+        return version;
+    }
+#endif
+#endif
+
+    /**
+     * Should be called once, automatically, at runtime, to initialize the static version number with the current OS value.
+     *
+     * Threads racing on the first check may each query the OS, but they all
+     * get the same answer and only the first one is published. Returns the
+     * published version.
+     *
+     * This is kept out-of-line (and cold, where supported), so that checks
+     * only inline the load and comparison.
+     */
+    ___WA_COLD inline PackedVersion _loadSystemVersion() {
+#ifdef ___WA_DLL_CLIENT
+        PackedVersion loaded = _providerSystemVersion();
+#else
+#ifdef WINDOWS_AVAILABILITY_ALLOW_OVERRIDE
+        if (PackedVersion overridden = _queryOverrideVersion()) {
+            overrideSystemVersion(WindowsVersion{ overridden });
+            return systemVersion.load(std::memory_order_acquire);
+        }
+#endif
+
+        PackedVersion loaded = _readSharedUserData();
+        if (!loaded)
+            loaded = _querySystemVersion();
+#endif
+
+        PackedVersion expected = 0;
+
+        if (!systemVersion.compare_exchange_strong(expected, loaded, std::memory_order_release, std::memory_order_acquire))
+            return expected;
+
+        return loaded;
+    }
+
+    /**
+     * Returns the packed system version, loading it first if needed.
+     */
+    inline PackedVersion _getSystemVersion() {
+#ifdef WINDOWS_AVAILABILITY_EAGER_INIT
+        // Already loaded during CRT startup, so there's nothing to check, but
+        // a check made before the initializer ran would compare against 0
+        PackedVersion current = systemVersion.load(std::memory_order_acquire);
+        assert(current);
+
+        return current;
+#else
+        PackedVersion current = systemVersion.load(std::memory_order_acquire);
+        if (!current)
+            current = _loadSystemVersion();
+
+        return current;
+#endif
+    }
+
+    /**
+     * Loads the update build revision of the OS (plus one) into
+     * `updateRevision`, returning the loaded value, or the value stored first
+     * by another thread or by `overrideSystemVersion`.
+     */
+    ___WA_COLD inline PackedVersion _loadUpdateRevision() {
+#ifdef ___WA_DLL_CLIENT
+        PackedVersion loaded = _providerUpdateRevision() + 1;
+#else
+        PackedVersion loaded = (static_cast<PackedVersion>(_queryUpdateRevision()) & detail::revisionMask) + 1;
+#endif
+        PackedVersion expected = 0;
+
+        if (!updateRevision.compare_exchange_strong(expected, loaded, std::memory_order_release, std::memory_order_acquire))
+            return expected;
+
+        return loaded;
+    }
+
+    /**
+     * Returns the update build revision of the OS, loading it first if needed.
+     */
+    inline PackedVersion _getUpdateRevision() {
+        PackedVersion current = updateRevision.load(std::memory_order_acquire);
+        if (!current)
+            current = _loadUpdateRevision();
+
+        return current - 1;
+    }
+
+    /**
+     * Compares a requirement that includes an update build revision, which
+     * only needs the revision of the OS if the rest of the version matches.
+     */
+    inline bool _isRevisionAtLeast(PackedVersion version, PackedVersion current) {
+        if ((version & ~detail::revisionMask) != current)
+            return version <= current;
+
+        return version <= (current | _getUpdateRevision());
+    }
+
+    /**
+     * The version comparison function, checking if the requested version is supported by the current OS.
+     *
+     * Called at runtime whenever a `__builtin_available(Windows ...)` block is encountered.
+     */
+    inline bool _isVersionAtLeast(PackedVersion version) {
+        if (version & detail::revisionMask)
+            return _isRevisionAtLeast(version, _getSystemVersion());
+
+        return version <= _getSystemVersion();
+    }
+
+    inline bool _isVersionAtLeast(const VersionTuple& version) {
+        return _isVersionAtLeast(detail::packVersion(version));
+    }
+
+    /**
+     * Compares a compile-time required version against the system version,
+     * so that only requirements with an update build revision instantiate the
+     * revision check (and its registry access).
+     */
+    template <PackedVersion version>
+    inline bool _isAtLeast(PackedVersion current) {
+        if constexpr ((version & detail::revisionMask) != 0) {
+            return _isRevisionAtLeast(version, current);
+        } else {
+            return version <= current;
+        }
+    }
+
+    /**
+     * Checks a compile-time required version, which is resolved without
+     * touching the system version if it can never match, or if the minimum
+     * target version already guarantees it.
+     */
+    template <PackedVersion version>
+    inline bool _isAvailable() {
+        if constexpr (version == detail::invalidVersion) {
+            return false;
+        } else if constexpr (version <= minimumTargetVersion) {
+            return true;
+        } else {
+            return _isAtLeast<version>(_getSystemVersion());
+        }
+    }
+
+#if ___WA_HAS_CLASS_NTTP
+    /**
+     * Checks whether any of the provided versions are supported by the current
+     * OS, as in `anyOf<"Windows 10 1809", "Windows 11 22H2">()`.
+     *
+     * Any number of alternatives can be provided, and they are reduced at
+     * compile-time so that there is at most one runtime comparison.
+     */
+    template <detail::FixedString... alternatives>
+    inline bool anyOf() {
+#ifdef WINDOWS_AVAILABILITY_STRICT
+        static_assert((detail::isValidRequirement(alternatives.view()) && ...), "anyOf has an invalid or misspelled Windows version");
+#endif
+
+        constexpr PackedVersion required = [] {
+            PackedVersion lowest = detail::invalidVersion;
+            ((lowest = (detail::requiredVersion(alternatives.view()) < lowest) ? detail::requiredVersion(alternatives.view()) : lowest), ...);
+            return lowest;
+        }();
+
+        return _isAvailable<required>();
+    }
+
+    /**
+     * Checks whether a WindowsVersion template argument is supported by the
+     * current OS, as in `isAvailable<"Windows 10 2004"_winver>()`.
+     */
+    template <WindowsVersion version>
+    inline bool isAvailable() {
+        return _isAvailable<version.packed>();
+    }
+
+    /**
+     * A compile-time set of up to 63 versions, which are all checked against
+     * the system version in a single pass the first time any of them is
+     * needed:
+     *
+     *     using Features = VersionMask<"Windows 10 1809"_winver, "Windows 11"_winver>;
+     *
+     *     if (Features::test<"Windows 11"_winver>())
+     *         ...
+     *
+     * After that, each check is a single bit test of a shared word.
+     */
+    template <WindowsVersion... versions>
+    class VersionMask {
+        static_assert(sizeof...(versions) < 64, "VersionMask supports at most 63 versions");
+
+    public:
+        /**
+         * Returns the results for every version, with bit `i` set if the
+         * `i`th version is supported.
+         */
+        static std::uint64_t bits() {
+            std::uint64_t current = state.load(std::memory_order_acquire);
+            if (!current)
+                current = evaluate();
+
+            return current & ~evaluatedBit;
+        }
+
+        /**
+         * Checks whether one of the versions in the mask is supported.
+         */
+        template <WindowsVersion version>
+        static bool test() {
+            constexpr std::size_t index = indexOf(version);
+            static_assert(index < sizeof...(versions), "The version is not part of this VersionMask");
+
+            return (bits() >> index) & 1;
+        }
+
+        /**
+         * Evaluates the mask now, if it hasn't been already.
+         */
+        static void initialize() {
+            bits();
+        }
+
+    private:
+        // Set once evaluated, so that a mask can't be mistaken for unevaluated
+        static constexpr std::uint64_t evaluatedBit = std::uint64_t(1) << 63;
+
+        static constexpr std::size_t indexOf(WindowsVersion version) {
+            constexpr WindowsVersion all[] = { versions... };
+
+            for (std::size_t i = 0; i < sizeof...(versions); i++) {
+                if (all[i] == version)
+                    return i;
+            }
+
+            return sizeof...(versions);
+        }
+
+        ___WA_COLD static std::uint64_t evaluate() {
+            PackedVersion current = _getSystemVersion();
+            std::uint64_t result = evaluatedBit;
+            std::size_t index = 0;
+
+            ((result |= std::uint64_t(_isAtLeast<versions.packed>(current)) << index++), ...);
+
+            state.store(result, std::memory_order_release);
+            return result;
+        }
+
+        inline static std::atomic<std::uint64_t> state{0};
+    };
+#endif
+
+    /**
+     * Checks whether a WindowsVersion is supported by the current OS.
+     */
+    inline bool isAvailable(WindowsVersion version) {
+        if (version <= minimumTarget)
+            return true;
+
+        return _isVersionAtLeast(version.packed);
+    }
+
+    /**
+     * A copy of the system version, taken with `snapshot()`.
+     *
+     * Checks against a snapshot are pure functions of a local value, so the
+     * compiler can keep it in a register and hoist checks out of loops:
+     *
+     *     auto caps = snapshot();
+     *     for (...) {
+     *         if (caps.atLeast<"Windows 11">())
+     *             ...
+     *     }
+     */
+    struct Snapshot {
+        // Only includes the update build revision if requested from `snapshot`
+        PackedVersion version;
+        bool includesRevision = false;
+
+        constexpr bool atLeast(WindowsVersion required) const {
+            return required <= minimumTarget || _satisfies(required.packed);
+        }
+
+#if ___WA_HAS_CLASS_NTTP
+        template <detail::FixedString alternatives>
+        constexpr bool atLeast() const {
+#ifdef WINDOWS_AVAILABILITY_STRICT
+            static_assert(detail::isValidRequirement(alternatives.view()), "Snapshot::atLeast has an invalid or misspelled Windows version");
+#endif
+
+            constexpr PackedVersion required = detail::requiredVersion(alternatives.view());
+
+            if constexpr (required <= minimumTargetVersion) {
+                return true;
+            } else {
+                return _satisfies(required);
+            }
+        }
+#endif
+
+        /**
+         * Compares against the snapshot, falling back to the cached update
+         * build revision for a requirement that needs one when the snapshot
+         * was taken without it.
+         */
+        constexpr bool _satisfies(PackedVersion required) const {
+            if (!includesRevision && (required & detail::revisionMask))
+                return _isRevisionAtLeast(required, version);
+
+            return required <= version;
+        }
+    };
+
+    /**
+     * Returns a Snapshot of the system version, loading it first if needed.
+     *
+     * With `includeRevision`, the snapshot also includes the update build
+     * revision (which may need to be read from the registry). Otherwise,
+     * requirements that include a revision still work, but need to look up
+     * the cached revision when the rest of the version matches.
+     */
+    inline Snapshot snapshot(bool includeRevision = false) {
+        if (includeRevision)
+            return Snapshot{ _getSystemVersion() | _getUpdateRevision(), true };
+
+        return Snapshot{ _getSystemVersion(), false };
+    }
+
+    /**
+     * The type of OS product, matching the `VER_NT_*` values.
+     */
+    enum class ProductType : DWORD {
+        Unknown = 0,
+        Workstation = 1,
+        DomainController = 2,
+        Server = 3,
+    };
+
+    /**
+     * The cached product type (in the low byte) and edition (in the high
+     * half), with bit 8 set once loaded.
+     */
+    inline std::atomic<std::uint64_t> productInfo{0};
+
+    /**
+     * Should be called once, automatically, at runtime, to load the product
+     * type and edition. The product type comes from the shared user data page
+     * where possible, falling back to ntdll.
+     */
+    ___WA_COLD inline std::uint64_t _loadProductInfo() {
+#ifdef ___WA_DLL_CLIENT
+        std::uint64_t loaded = _providerProductInfo();
+#else
+        DWORD type = 0;
+
+#ifndef WINDOWS_AVAILABILITY_NO_SHARED_USER_DATA
+        constexpr std::uintptr_t sharedUserData = ___WA_SHARED_USER_DATA;
+        constexpr std::uintptr_t ntProductTypeOffset = 0x264;
+        constexpr std::uintptr_t productTypeIsValidOffset = 0x268;
+
+        if (*reinterpret_cast<const volatile unsigned char*>(sharedUserData + productTypeIsValidOffset))
+            type = *reinterpret_cast<const volatile DWORD*>(sharedUserData + ntProductTypeOffset);
+#endif
+
+        if (!type)
+            type = _queryProductType();
+
+        DWORD edition = _queryProductEdition(_getSystemVersion());
+
+        std::uint64_t loaded = (static_cast<std::uint64_t>(edition) << 32) | 0x100 | (type & 0xFF);
+#endif
+        productInfo.store(loaded, std::memory_order_release);
+        return loaded;
+    }
+
+    inline std::uint64_t _getProductInfo() {
+        std::uint64_t current = productInfo.load(std::memory_order_acquire);
+        if (!current)
+            current = _loadProductInfo();
+
+        return current;
+    }
+
+    /**
+     * Returns the product type of the OS.
+     */
+    inline ProductType productType() {
+        return static_cast<ProductType>(_getProductInfo() & 0xFF);
+    }
+
+    /**
+     * Returns whether the OS is a server product (including domain
+     * controllers).
+     */
+    inline bool isServer() {
+        ProductType type = productType();
+        return type == ProductType::Server || type == ProductType::DomainController;
+    }
+
+    /**
+     * Returns whether the OS is a client (workstation) product.
+     */
+    inline bool isWorkstation() {
+        return productType() == ProductType::Workstation;
+    }
+
+    /**
+     * Returns the edition of the OS, as one of the `PRODUCT_*` values from
+     * `GetProductInfo`, or 0 (`PRODUCT_UNDEFINED`) if it can't be determined.
+     */
+    inline DWORD productEdition() {
+        return static_cast<DWORD>(_getProductInfo() >> 32);
+    }
+
+#if defined(WINDOWS_AVAILABILITY_DLL) && defined(WINDOWS_AVAILABILITY_IMPLEMENTATION)
+    ___WA_API PackedVersion _providerSystemVersion() {
+        return _getSystemVersion();
+    }
+
+    ___WA_API PackedVersion _providerUpdateRevision() {
+        return _getUpdateRevision();
+    }
+
+    ___WA_API std::uint64_t _providerProductInfo() {
+        return _getProductInfo();
+    }
+#endif
+
+    template <typename Signature, std::size_t N>
+    class VersionDispatch;
+
+    /**
+     * Chooses between several implementations of a function based on the
+     * current OS version, like a GNU ifunc.
+     *
+     * The best implementation (the one with the highest minimum version that
+     * the OS supports, or the fallback if none of them are) is chosen on the
+     * first call and stored, so every later call is an indirect call with no
+     * version comparisons:
+     *
+     *     static VersionDispatch<void(int), 2> draw{ drawLegacy, {
+     *         { "Windows 10 1809"_winver, drawFast },
+     *         { "Windows 11"_winver, drawFastest },
+     *     } };
+     *
+     *     draw(42);
+     *
+     * This can be constant-initialized as a static, so it costs nothing at
+     * startup unless `resolve` is called explicitly.
+     */
+    template <typename R, typename... Args, std::size_t N>
+    class VersionDispatch<R(Args...), N> {
+    public:
+        typedef R (*Function)(Args...);
+
+        struct Candidate {
+            WindowsVersion minimum;
+            Function function;
+        };
+
+        constexpr VersionDispatch(Function fallbackFunction, const Candidate (&candidateList)[N]) : fallback(fallbackFunction), candidates(), resolved(nullptr) {
+            for (std::size_t i = 0; i < N; i++)
+                candidates[i] = candidateList[i];
+        }
+
+        VersionDispatch(const VersionDispatch&) = delete;
+        VersionDispatch& operator=(const VersionDispatch&) = delete;
+
+        R operator()(Args... args) const {
+            Function function = resolved.load(std::memory_order_acquire);
+            if (!function)
+                function = resolve();
+
+            return function(std::forward<Args>(args)...);
+        }
+
+        /**
+         * Chooses the implementation now, if it hasn't been already, and
+         * returns it.
+         */
+        Function resolve() const {
+            Function function = fallback;
+            WindowsVersion best{ 0 };
+
+            for (const Candidate& candidate : candidates) {
+                if (candidate.minimum >= best && isAvailable(candidate.minimum)) {
+                    function = candidate.function;
+                    best = candidate.minimum;
+                }
+            }
+
+            resolved.store(function, std::memory_order_release);
+            return function;
+        }
+
+    private:
+        Function fallback;
+        Candidate candidates[N];
+        mutable std::atomic<Function> resolved;
+    };
+
+    /**
+     * A function that may not exist on every supported version of Windows,
+     * looked up from its module the first time it's needed:
+     *
+     *     static ApiFunction<decltype(&SetThreadDescription)> setThreadDescription{ L"kernel32.dll", "SetThreadDescription" };
+     *
+     *     if (auto fn = setThreadDescription.get())
+     *         fn(GetCurrentThread(), L"Worker");
+     *
+     * Like the system version, the result is published atomically, so after
+     * the first lookup `get` is a single load. The module must already be
+     * loaded, since this never loads libraries itself.
+     */
+    template <typename Signature>
+    class ApiFunction {
+    public:
+        typedef std::conditional_t<std::is_function_v<Signature>, Signature*, Signature> Function;
+
+        constexpr ApiFunction(const wchar_t* module, const char* name) : moduleName(module), procName(name), address(unresolved) { }
+
+        ApiFunction(const ApiFunction&) = delete;
+        ApiFunction& operator=(const ApiFunction&) = delete;
+
+        /**
+         * Returns the function, or nullptr if it isn't available.
+         */
+        Function get() const {
+            std::uintptr_t current = address.load(std::memory_order_acquire);
+            if (current == unresolved)
+                current = resolve();
+
+            return reinterpret_cast<Function>(current);
+        }
+
+        explicit operator bool() const {
+            return get() != nullptr;
+        }
+
+    private:
+        // Never a valid function address, so it can mark an unresolved function
+        static constexpr std::uintptr_t unresolved = 1;
+
+        ___WA_COLD std::uintptr_t resolve() const {
+            std::uintptr_t expected = unresolved;
+            std::uintptr_t loaded = reinterpret_cast<std::uintptr_t>(_resolveProcAddress(moduleName, procName));
+
+            if (!address.compare_exchange_strong(expected, loaded, std::memory_order_release, std::memory_order_acquire))
+                return expected;
+
+            return loaded;
+        }
+
+        const wchar_t* moduleName;
+        const char* procName;
+        mutable std::atomic<std::uintptr_t> address;
+    };
+
+    /**
+     * Loads the system version now, if it hasn't been loaded already.
+     *
+     * This never needs to be called explicitly, but can be used to move the
+     * cost of loading the version to a known point during startup. In kernel
+     * mode it also loads the product info, so that `productType()` and
+     * `productEdition()` can then be used at any IRQL.
+     */
+    inline void initialize() {
+        if (!systemVersion.load(std::memory_order_acquire))
+            _loadSystemVersion();
+
+#ifdef WINDOWS_AVAILABILITY_KERNEL_MODE
+        // Loaded now, while still at PASSIVE_LEVEL
+        _getProductInfo();
+#endif
+    }
+
+    /**
+     * The one-time result of a single `__builtin_available(...)` expression,
+     * used when `WINDOWS_AVAILABILITY_CACHE_RESULTS` is defined.
+     *
+     * The result can't change during the lifetime of the process, so after
+     * the first evaluation every check is a single load of a byte that always
+     * holds the same value.
+     */
+    struct _CachedResult {
+        // 0 if not yet evaluated, otherwise 1 for false and 2 for true
+        std::atomic<unsigned char> state{0};
+
+        template <typename F>
+        bool get(F evaluate) {
+            unsigned char cached = state.load(std::memory_order_relaxed);
+            if (cached)
+                return cached == 2;
+
+            bool result = evaluate();
+            state.store(result ? 2 : 1, std::memory_order_relaxed);
+            return result;
+        }
+    };
+
+    /**
+     * Checks a compile-time required version with the result cached per call
+     * site (there's one instantiation per `evaluate` lambda). Checks that can
+     * be resolved at compile-time skip the cache, so that the branch they
+     * rule out can still be removed.
+     */
+    template <PackedVersion version, typename F>
+    inline bool _isAvailableCached(F evaluate) {
+        if constexpr (version == detail::invalidVersion || version <= minimumTargetVersion) {
+            return _isAvailable<version>();
+        } else {
+            static _CachedResult cached;
+            return cached.get(evaluate);
+        }
+    }
+
+#ifdef WINDOWS_AVAILABILITY_INSTRUMENT
+    struct CheckSite;
+
+    // The most recently registered check site, linked through `next`
+    ___WA_SHARED(std::atomic<CheckSite*>, checkSites);
+
+#ifdef WINDOWS_AVAILABILITY_TELEMETRY
+    ___WA_RUNTIME void __cdecl _exportCheckSitesAtExit();
+#endif
+
+    /**
+     * A single `__builtin_available(...)` expression and how often it has
+     * gone each way, recorded when `WINDOWS_AVAILABILITY_INSTRUMENT` is
+     * defined.
+     *
+     * A site is registered the first time it's evaluated, and stays
+     * registered for the lifetime of the process. With
+     * `WINDOWS_AVAILABILITY_DLL`, every module shares one list of sites, so
+     * a module that registers sites must not be unloaded before exit (its
+     * sites would be left dangling in the list).
+     */
+    struct CheckSite {
+        const char* file;
+        unsigned line;
+        // The arguments exactly as written, e.g. "Windows 10 1809, macOS 10.15"
+        const char* requirement;
+        // The required Windows version, or `detail::invalidVersion`
+        PackedVersion version;
+
+        std::atomic<std::uint64_t> trueCount{0};
+        std::atomic<std::uint64_t> falseCount{0};
+        CheckSite* next = nullptr;
+
+        CheckSite(const char* siteFile, unsigned siteLine, const char* siteRequirement, PackedVersion siteVersion)
+            : file(siteFile), line(siteLine), requirement(siteRequirement), version(siteVersion)
+        {
+            next = checkSites.load(std::memory_order_relaxed);
+            while (!checkSites.compare_exchange_weak(next, this, std::memory_order_release, std::memory_order_relaxed))
+                ;
+
+#ifdef WINDOWS_AVAILABILITY_TELEMETRY
+            // Only the first site to be registered sets up the export
+            if (!next)
+                std::atexit(_exportCheckSitesAtExit);
+#endif
+        }
+
+        bool record(bool result) {
+            (result ? trueCount : falseCount).fetch_add(1, std::memory_order_relaxed);
+            return result;
+        }
+
+        std::uint64_t evaluations() const {
+            return trueCount.load(std::memory_order_relaxed) + falseCount.load(std::memory_order_relaxed);
+        }
+    };
+
+    /**
+     * Calls `f` with each registered check site, most recently registered
+     * first.
+     *
+     * Sites can be registered by other threads during the enumeration, but
+     * those won't be visited.
+     */
+    template <typename F>
+    void forEachCheckSite(F f) {
+        for (const CheckSite* site = checkSites.load(std::memory_order_acquire); site; site = site->next)
+            f(*site);
+    }
+
+#ifdef WINDOWS_AVAILABILITY_TELEMETRY
+    namespace detail {
+        inline void appendNumber(std::string& out, std::uint64_t value) {
+            char digits[20];
+            int count = 0;
+            do {
+                digits[count++] = static_cast<char>('0' + value % 10);
+                value /= 10;
+            } while (value);
+
+            while (count)
+                out += digits[--count];
+        }
+
+        inline void appendVersion(std::string& out, PackedVersion version) {
+            out += '"';
+            appendNumber(out, version >> 56);
+            out += '.';
+            appendNumber(out, (version >> 48) & 0xFF);
+            out += '.';
+            appendNumber(out, (version >> 24) & 0xFFFFFF);
+            if (version & revisionMask) {
+                out += '.';
+                appendNumber(out, version & revisionMask);
+            }
+            out += '"';
+        }
+
+        inline void appendString(std::string& out, const char* s) {
+            out += '"';
+            for (; *s; s++) {
+                unsigned char c = static_cast<unsigned char>(*s);
+                if (c == '"' || c == '\\') {
+                    out += '\\';
+                    out += *s;
+                } else if (c < 0x20) {
+                    out += "\\u00";
+                    out += "0123456789abcdef"[c >> 4];
+                    out += "0123456789abcdef"[c & 0xF];
+                } else {
+                    out += *s;
+                }
+            }
+            out += '"';
+        }
+    }
+
+    /**
+     * Returns a JSON report of the system version and every registered check
+     * site, on a single line, e.g.
+     *
+     *     {"system":"10.0.19045.3570","sites":[{"file":"draw.cpp","line":12,
+     *      "requirement":"Windows 10 1809","version":"10.0.17763","true":1024,
+     *      "false":0}]}
+     *
+     * The update build revision is only included if it was already loaded,
+     * since loading it reads the registry, which isn't safe under the loader
+     * lock during `DLL_PROCESS_DETACH`. An invalid version (a check with no
+     * Windows requirement) is reported as null. This is only meant to be
+     * called at shutdown, since it allocates.
+     */
+    inline std::string checkSiteReport() {
+        std::string out = "{\"system\":";
+
+        PackedVersion system = systemVersion.load(std::memory_order_acquire);
+        PackedVersion revision = updateRevision.load(std::memory_order_acquire);
+        if (system)
+            detail::appendVersion(out, system | (revision ? revision - 1 : 0));
+        else
+            out += "null";
+
+        out += ",\"sites\":[";
+
+        bool first = true;
+        forEachCheckSite([&](const CheckSite& site) {
+            out += first ? "{\"file\":" : ",{\"file\":";
+            first = false;
+
+            detail::appendString(out, site.file);
+            out += ",\"line\":";
+            detail::appendNumber(out, site.line);
+            out += ",\"requirement\":";
+            detail::appendString(out, site.requirement);
+            out += ",\"version\":";
+            if (site.version == detail::invalidVersion)
+                out += "null";
+            else
+                detail::appendVersion(out, site.version);
+            out += ",\"true\":";
+            detail::appendNumber(out, site.trueCount.load(std::memory_order_relaxed));
+            out += ",\"false\":";
+            detail::appendNumber(out, site.falseCount.load(std::memory_order_relaxed));
+            out += '}';
+        });
+
+        out += "]}\n";
+        return out;
+    }
+
+    /**
+     * Appends `checkSiteReport()` to a file with a single write, creating the
+     * file if needed. Every module (and process) exporting to the same file
+     * adds its own line. Returns whether the whole report was written.
+     */
+    ___WA_RUNTIME bool exportCheckSites(const wchar_t* path);
+
+#if ___WA_HAS_RUNTIME
+    ___WA_RUNTIME bool exportCheckSites(const wchar_t* path) {
+        std::string report = checkSiteReport();
+
+        HANDLE file = CreateFileW(path, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+
+        DWORD written = 0;
+        BOOL success = WriteFile(file, report.data(), static_cast<DWORD>(report.size()), &written, nullptr);
+
+        CloseHandle(file);
+        return success && written == report.size();
+    }
+
+    /**
+     * Registered with `atexit` when `WINDOWS_AVAILABILITY_TELEMETRY` is
+     * defined, exporting the check sites to the file named by the
+     * `WINDOWS_AVAILABILITY_TELEMETRY` environment variable, if it's set.
+     * Each module keeps its own sites (unless built with
+     * `WINDOWS_AVAILABILITY_DLL`), so each appends its own line at exit.
+     */
+    ___WA_RUNTIME void __cdecl _exportCheckSitesAtExit() {
+        wchar_t path[MAX_PATH];
+        DWORD length = GetEnvironmentVariableW(L"WINDOWS_AVAILABILITY_TELEMETRY", path, MAX_PATH);
+        if (length == 0 || length >= MAX_PATH)
+            return;
+
+        exportCheckSites(path);
+    }
+#endif
+#endif // WINDOWS_AVAILABILITY_TELEMETRY
+#endif // WINDOWS_AVAILABILITY_INSTRUMENT
+}
+
+/**
+ * With `WINDOWS_AVAILABILITY_EAGER_INIT` defined, the system version is loaded
+ * during CRT startup (before `main`, or during `DllMain` for a DLL) and checks
+ * skip testing whether it still needs to be loaded.
+ *
+ * The initializer is placed in `.CRT$XCL` (or given a high constructor
+ * priority) so that it runs before ordinary static initializers, but checks
+ * made from earlier initializers will fail (and assert in debug builds). This
+ * must be defined consistently for every translation unit in a module.
+ */
+#ifdef WINDOWS_AVAILABILITY_EAGER_INIT
+#if defined(_MSC_VER)
+extern "C" inline void __cdecl ___windows_availability_eager_init() {
+    __builtin_availability::initialize();
+}
+
+#if defined(_M_IX86)
+#define ___WA_SYMBOL_PREFIX                     "_"
+#else
+#define ___WA_SYMBOL_PREFIX                     ""
+#endif
+
+#pragma section(".CRT$XCL", long, read)
+extern "C" __declspec(selectany) __declspec(allocate(".CRT$XCL")) void (__cdecl * const ___windows_availability_eager_init_ptr)() = ___windows_availability_eager_init;
+#pragma comment(linker, "/include:" ___WA_SYMBOL_PREFIX "___windows_availability_eager_init_ptr")
+#elif defined(__GNUC__)
+__attribute__((constructor(101))) static void ___windows_availability_eager_init() {
+    __builtin_availability::initialize();
+}
+#else
+#error "WINDOWS_AVAILABILITY_EAGER_INIT is not supported with this compiler"
+#endif
+#endif // WINDOWS_AVAILABILITY_EAGER_INIT
+
+#endif // WINDOWS_AVAILABILITY_MODULE
+
+/**
+ * Each check passes its required version as a template argument, which forces
+ * the parsing to happen at compile-time without a lambda per call site. Every
+ * check for the same version shares a single `_isAvailable` instantiation.
+ */
+#ifdef WINDOWS_AVAILABILITY_STRICT
+#define ___windows_available_check(x)           (__builtin_availability::_isAvailable<__builtin_availability::detail::StrictVersion< \
+    __builtin_availability::detail::isValidRequirement(x), __builtin_availability::detail::requiredVersion(x)>::value>())
+#else
+#define ___windows_available_check(x)           (__builtin_availability::_isAvailable<__builtin_availability::detail::requiredVersion(x)>())
+#endif
+
+#define ___windows_available_string(...)        #__VA_ARGS__
+#ifdef WINDOWS_AVAILABILITY_CACHE_RESULTS
+#define ___windows_available_evaluate(...)      (__builtin_availability::_isAvailableCached< \
+    __builtin_availability::detail::requiredVersion(___windows_available_string(__VA_ARGS__))>( \
+    []{ return ___windows_available_check(___windows_available_string(__VA_ARGS__)); }))
+#else
+#define ___windows_available_evaluate(...)      ___windows_available_check(___windows_available_string(__VA_ARGS__))
+#endif
+
+#ifdef WINDOWS_AVAILABILITY_INSTRUMENT
+#define ___windows_available(...)               ([]{ \
+    static __builtin_availability::CheckSite site(__FILE__, __LINE__, ___windows_available_string(__VA_ARGS__), \
+        __builtin_availability::detail::requiredVersion(___windows_available_string(__VA_ARGS__))); \
+    return site.record(___windows_available_evaluate(__VA_ARGS__)); }())
+#else
+#define ___windows_available(...)               ___windows_available_evaluate(__VA_ARGS__)
+#endif
+
+#define windows_version_available               ___windows_available
+#define windows_version(...)                    __VA_ARGS__
+
+/**
+ * Variants of `windows_version_available` that tell the compiler which way
+ * the check is expected to go, so that the unexpected branch can be laid out
+ * away from the hot path (in `.text.unlikely` with GCC's block partitioning).
+ *
+ * With `WINDOWS_AVAILABILITY_ASSUME_LIKELY` defined, `__builtin_available`
+ * expects every check to pass, which suits a fleet where the fallback
+ * branches are for rare older hosts.
+ *
+ * MSVC has no way to annotate an expression, so there these are the same as
+ * `windows_version_available`.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define ___windows_available_expect(x, v)       (static_cast<bool>(__builtin_expect(!!(x), v)))
+#else
+#define ___windows_available_expect(x, v)       (x)
+#endif
+
+#define windows_version_likely(...)             ___windows_available_expect(___windows_available(__VA_ARGS__), 1)
+#define windows_version_unlikely(...)           ___windows_available_expect(___windows_available(__VA_ARGS__), 0)
+
+/**
+ * Defining `NO_BUILTIN_AVAILABLE_CLOBBER` leaves `__builtin_available` alone
+ * (i.e. for a compiler that supports it natively), and checks can be made with
+ * `windows_version_available` instead. No compiler supports Windows versions
+ * in `__builtin_available` yet, and clang's `__has_builtin` reports it for
+ * every target, so this isn't detected automatically.
+ */
+#ifndef NO_BUILTIN_AVAILABLE_CLOBBER
+#ifdef WINDOWS_AVAILABILITY_ASSUME_LIKELY
+#define __builtin_available                     windows_version_likely
+#else
+#define __builtin_available                     ___windows_available
+#endif
 #endif
 
 #else // _WIN32
 
 #define windows_version_available(...)          false
+#define windows_version_likely(...)             false
+#define windows_version_unlikely(...)           false
 #define windows_version(...)
 
 #endif // _WIN32
@@ -0,0 +1,39 @@
+// -*- C++ -*- runtime.
+
+// Copyright (c) 2022 Darryl Pogue
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/**
+ * The out-of-line runtime for builds using `WINDOWS_AVAILABILITY_NO_WINDOWS_H`.
+ *
+ * Compile this once into the program, with the same configuration macros as
+ * everything else, to provide the functions that need <windows.h>.
+ *
+ * With `WINDOWS_AVAILABILITY_DLL` defined, build this as its own DLL instead,
+ * which exports the runtime and the cached state to every module that links
+ * against it.
+ */
+
+#ifndef WINDOWS_AVAILABILITY_NO_WINDOWS_H
+#define WINDOWS_AVAILABILITY_NO_WINDOWS_H
+#endif
+
+#define WINDOWS_AVAILABILITY_IMPLEMENTATION
+#include "../include/windows_availability.h"
@@ -0,0 +1,60 @@
+// -*- C++ -*- module interface.
+
+// Copyright (c) 2022 Darryl Pogue
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+/**
+ * The `windows_availability` named module, exporting the version types, the
+ * compile-time parser, and the runtime query.
+ *
+ * Code importing this should include <windows_availability> with
+ * `WINDOWS_AVAILABILITY_MODULE` defined, which imports the module and defines
+ * the `__builtin_available` macros on top of it. The module must be built
+ * with the same configuration macros as the code that imports it.
+ */
+
+module;
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <tuple>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#ifdef WINDOWS_AVAILABILITY_TELEMETRY
+#include <cstdlib>
+#include <string>
+#endif
+
+#if defined(WINDOWS_AVAILABILITY_KERNEL_MODE)
+#include <wdm.h>
+#elif !defined(WINDOWS_AVAILABILITY_NO_WINDOWS_H)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <tchar.h>
+#endif
+
+export module windows_availability;
+
+#define ___WA_MODULE_INTERFACE
+#define ___WA_EXPORT                            export
+#include "../include/windows_availability.h"